@@ -0,0 +1,429 @@
+#ifndef COMSOL_SNAPSHOT_HH
+#define COMSOL_SNAPSHOT_HH
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Garfield/Component.hh"
+#include "Garfield/Medium.hh"
+
+/*
+Binary snapshot of a COMSOL model, written once by comsol_snapshot/make_snapshot.C. The mesh (nodes, quadratic
+tetrahedra, materials and a bucket grid for the element search) goes in one file and every potential map goes in its
+own file holding one value per mesh node. Both are memory-mapped read-only, so loading takes no parsing and no copying,
+and all processes of a sweep share the same pages.
+
+ComsolSnapshot serves the field from the mapped arrays the same way Garfield's field maps do for quadratic tetrahedra,
+except that elements are treated as straight-sided (mid-side nodes at the edge midpoints); make_snapshot.C compares it
+with the ComponentComsol it was made from. Like ComponentComsol, it returns the status of a failed lookup as it is;
+wrap it in a SafeField (common/safe_field.hh) to fall back to the last good field instead.
+*/
+
+namespace ComsolSnapshotFormat
+{
+  const char meshMagic[8] = {'P', 'U', 'M', 'A', 'M', 'E', 'S', 'H'};
+  const char potentialMagic[8] = {'P', 'U', 'M', 'A', 'P', 'O', 'T', '\0'};
+  const uint32_t version = 1;
+
+  struct MeshHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t nMaterials;
+    uint64_t nNodes;
+    uint64_t nElements;
+    uint64_t meshId; // hash of the node coordinates; potential files must carry the same id
+    double bbMin[3];
+    double bbMax[3];
+    uint32_t nCells[3]; // bucket grid used to find the element containing a point
+    uint32_t padding;
+    uint64_t nCellEntries;
+    // Byte offsets of the sections, all 8-byte aligned
+    uint64_t nodesOffset;           // double[3 * nNodes], x y z in cm
+    uint64_t elementsOffset;        // uint32_t[10 * nElements], Garfield node order
+    uint64_t elementMaterialOffset; // uint32_t[nElements]
+    uint64_t permittivityOffset;    // double[nMaterials]
+    uint64_t driftOffset;           // uint32_t[nMaterials], 1 if the material is the drift medium
+    uint64_t cellStartOffset;       // uint64_t[nCells + 1]
+    uint64_t cellEntriesOffset;     // uint32_t[nCellEntries], element indices per bucket
+  };
+
+  struct PotentialHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t padding;
+    uint64_t nNodes;
+    uint64_t meshId;
+    double vMin;
+    double vMax;
+    uint64_t potentialOffset; // double[nNodes], V
+  };
+
+  // FNV-1a over the raw node coordinates
+  inline uint64_t MeshId(const double *nodes, uint64_t nNodes)
+  {
+    uint64_t hash = 1469598103934665603ULL;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(nodes);
+    for (uint64_t i = 0; i < 3 * nNodes * sizeof(double); ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+}
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string &fileName)
+  {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+      void *address = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (address != MAP_FAILED)
+      {
+        data = static_cast<const char *>(address);
+        size = info.st_size;
+      }
+    }
+    close(fd);
+  }
+
+  ~MappedFile()
+  {
+    if (data)
+      munmap(const_cast<char *>(data), size);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  template <class T>
+  const T *At(uint64_t offset) const { return reinterpret_cast<const T *>(data + offset); }
+
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+class ComsolSnapshot : public Garfield::Component
+{
+public:
+  ComsolSnapshot() : Component("ComsolSnapshot") {}
+
+  // Maps the mesh and a potential map
+  bool Load(const std::string &meshFile, const std::string &potentialFile)
+  {
+    return LoadMesh(meshFile) && LoadPotential(potentialFile);
+  }
+
+  bool LoadMesh(const std::string &meshFile)
+  {
+    using namespace ComsolSnapshotFormat;
+    m_ready = false;
+    auto file = std::make_shared<MappedFile>(meshFile);
+    if (!file->data || file->size < sizeof(MeshHeader))
+    {
+      std::cerr << "ComsolSnapshot: cannot map " << meshFile << "\n";
+      return false;
+    }
+    const MeshHeader *header = file->At<MeshHeader>(0);
+    if (std::memcmp(header->magic, meshMagic, 8) != 0 || header->version != version ||
+        file->size < header->cellEntriesOffset + header->nCellEntries * sizeof(uint32_t))
+    {
+      std::cerr << "ComsolSnapshot: " << meshFile << " is not a mesh snapshot\n";
+      return false;
+    }
+
+    mesh = file;
+    meshHeader = header;
+    nodes = file->At<double>(header->nodesOffset);
+    elements = file->At<uint32_t>(header->elementsOffset);
+    elementMaterial = file->At<uint32_t>(header->elementMaterialOffset);
+    driftMaterial = file->At<uint32_t>(header->driftOffset);
+    cellStart = file->At<uint64_t>(header->cellStartOffset);
+    cellEntries = file->At<uint32_t>(header->cellEntriesOffset);
+    for (int i = 0; i < 3; ++i)
+      cellSize[i] = (header->bbMax[i] - header->bbMin[i]) / header->nCells[i];
+
+    // A potential map from another mesh cannot be used any more
+    potentials.reset();
+    potential = nullptr;
+    return true;
+  }
+
+  // Uses the mesh mapped by another snapshot, so that one snapshot per potential map can be kept without mapping the
+  // mesh again
+  bool ShareMesh(const ComsolSnapshot &other)
+  {
+    m_ready = false;
+    if (!other.mesh)
+    {
+      std::cerr << "ComsolSnapshot: no mesh to share\n";
+      return false;
+    }
+    mesh = other.mesh;
+    meshHeader = other.meshHeader;
+    nodes = other.nodes;
+    elements = other.elements;
+    elementMaterial = other.elementMaterial;
+    driftMaterial = other.driftMaterial;
+    cellStart = other.cellStart;
+    cellEntries = other.cellEntries;
+    std::copy(other.cellSize, other.cellSize + 3, cellSize);
+
+    potentials.reset();
+    potential = nullptr;
+    return true;
+  }
+
+  // Swaps in another potential map of the same mesh
+  bool LoadPotential(const std::string &potentialFile)
+  {
+    using namespace ComsolSnapshotFormat;
+    m_ready = false;
+    if (!mesh)
+    {
+      std::cerr << "ComsolSnapshot: load the mesh first\n";
+      return false;
+    }
+    auto file = std::make_shared<MappedFile>(potentialFile);
+    if (!file->data || file->size < sizeof(PotentialHeader))
+    {
+      std::cerr << "ComsolSnapshot: cannot map " << potentialFile << "\n";
+      return false;
+    }
+    const PotentialHeader *header = file->At<PotentialHeader>(0);
+    if (std::memcmp(header->magic, potentialMagic, 8) != 0 || header->version != version ||
+        header->nNodes != meshHeader->nNodes || header->meshId != meshHeader->meshId ||
+        file->size < header->potentialOffset + header->nNodes * sizeof(double))
+    {
+      std::cerr << "ComsolSnapshot: " << potentialFile << " does not belong to the loaded mesh\n";
+      return false;
+    }
+
+    potentials = file;
+    potentialHeader = header;
+    potential = file->At<double>(header->potentialOffset);
+    m_ready = true;
+    return true;
+  }
+
+  // Medium used in the drift regions of the model (the materials flagged as drift medium by COMSOL/Garfield)
+  void SetGas(Garfield::Medium *m) { gas = m; }
+
+  using Component::ElectricField;
+
+  void ElectricField(const double x, const double y, const double z,
+                     double &ex, double &ey, double &ez, Garfield::Medium *&m, int &status) override
+  {
+    double v = 0.;
+    ElectricField(x, y, z, ex, ey, ez, v, m, status);
+  }
+
+  void ElectricField(const double x, const double y, const double z,
+                     double &ex, double &ey, double &ez, double &v,
+                     Garfield::Medium *&m, int &status) override
+  {
+    Evaluate(x, y, z, ex, ey, ez, v, m, status);
+  }
+
+  // Field at a point. Status is 0 in the drift medium, -5 in other materials and -6 outside the mesh, as for
+  // Garfield's field maps.
+  void Evaluate(const double x, const double y, const double z,
+                double &ex, double &ey, double &ez, double &v, Garfield::Medium *&m, int &status) const
+  {
+    ex = ey = ez = v = 0.;
+    m = nullptr;
+    double t[4], grad[4][3];
+    const uint64_t element = m_ready ? Locate(x, y, z, t, grad) : noElement;
+    if (element == noElement)
+    {
+      status = -6;
+      return;
+    }
+
+    const uint32_t *n = elements + 10 * element;
+    double p[10];
+    for (int i = 0; i < 10; ++i)
+      p[i] = potential[n[i]];
+
+    // Quadratic tetrahedron: potential and its derivatives with respect to the barycentric coordinates
+    v = p[0] * t[0] * (2 * t[0] - 1) + p[1] * t[1] * (2 * t[1] - 1) + p[2] * t[2] * (2 * t[2] - 1) +
+        p[3] * t[3] * (2 * t[3] - 1) +
+        4 * (p[4] * t[0] * t[1] + p[5] * t[0] * t[2] + p[6] * t[0] * t[3] +
+             p[7] * t[1] * t[2] + p[8] * t[1] * t[3] + p[9] * t[2] * t[3]);
+    const double dv[4] = {
+        p[0] * (4 * t[0] - 1) + 4 * (p[4] * t[1] + p[5] * t[2] + p[6] * t[3]),
+        p[1] * (4 * t[1] - 1) + 4 * (p[4] * t[0] + p[7] * t[2] + p[8] * t[3]),
+        p[2] * (4 * t[2] - 1) + 4 * (p[5] * t[0] + p[7] * t[1] + p[9] * t[3]),
+        p[3] * (4 * t[3] - 1) + 4 * (p[6] * t[0] + p[8] * t[1] + p[9] * t[2])};
+    ex = -(dv[0] * grad[0][0] + dv[1] * grad[1][0] + dv[2] * grad[2][0] + dv[3] * grad[3][0]);
+    ey = -(dv[0] * grad[0][1] + dv[1] * grad[1][1] + dv[2] * grad[2][1] + dv[3] * grad[3][1]);
+    ez = -(dv[0] * grad[0][2] + dv[1] * grad[1][2] + dv[2] * grad[2][2] + dv[3] * grad[3][2]);
+
+    if (driftMaterial[elementMaterial[element]] && gas)
+    {
+      m = gas;
+      status = gas->IsDriftable() ? 0 : -5;
+    }
+    else
+    {
+      status = -5;
+    }
+  }
+
+  double ElectricPotential(const double x, const double y, const double z) override
+  {
+    double ex, ey, ez, v;
+    Garfield::Medium *m;
+    int status;
+    Evaluate(x, y, z, ex, ey, ez, v, m, status);
+    return v;
+  }
+
+  Garfield::Medium *GetMedium(const double x, const double y, const double z) override
+  {
+    double t[4], grad[4][3];
+    const uint64_t element = m_ready ? Locate(x, y, z, t, grad) : noElement;
+    if (element == noElement || !driftMaterial[elementMaterial[element]])
+      return nullptr;
+    return gas;
+  }
+
+  bool GetVoltageRange(double &vmin, double &vmax) override
+  {
+    if (!m_ready)
+      return false;
+    vmin = potentialHeader->vMin;
+    vmax = potentialHeader->vMax;
+    return true;
+  }
+
+  bool GetBoundingBox(double &xmin, double &ymin, double &zmin,
+                      double &xmax, double &ymax, double &zmax) override
+  {
+    if (!mesh)
+      return false;
+    xmin = meshHeader->bbMin[0];
+    ymin = meshHeader->bbMin[1];
+    zmin = meshHeader->bbMin[2];
+    xmax = meshHeader->bbMax[0];
+    ymax = meshHeader->bbMax[1];
+    zmax = meshHeader->bbMax[2];
+    return true;
+  }
+
+  uint64_t GetNumberOfNodes() const { return mesh ? meshHeader->nNodes : 0; }
+  uint64_t GetNumberOfElements() const { return mesh ? meshHeader->nElements : 0; }
+
+private:
+  // Pure virtual in Garfield::Component. The snapshot is read-only once loaded and the mesh has no periodicities.
+  void Reset() override {}
+  void UpdatePeriodicity() override {}
+
+  static constexpr uint64_t noElement = std::numeric_limits<uint64_t>::max();
+
+  // Per thread, since drift threads share one component; keyed by the mesh it came from
+  static inline thread_local const void *lastMesh = nullptr;
+  static inline thread_local uint64_t lastElement = 0;
+
+  // Barycentric coordinates of a point in an element and their gradients; false if the point is outside
+  bool Barycentric(uint64_t element, double x, double y, double z, double t[4], double grad[4][3]) const
+  {
+    const uint32_t *n = elements + 10 * element;
+    const double *p0 = nodes + 3 * n[0];
+    double a[3], b[3], c[3];
+    for (int i = 0; i < 3; ++i)
+    {
+      a[i] = nodes[3 * n[1] + i] - p0[i];
+      b[i] = nodes[3 * n[2] + i] - p0[i];
+      c[i] = nodes[3 * n[3] + i] - p0[i];
+    }
+    const double bc[3] = {b[1] * c[2] - b[2] * c[1], b[2] * c[0] - b[0] * c[2], b[0] * c[1] - b[1] * c[0]};
+    const double ca[3] = {c[1] * a[2] - c[2] * a[1], c[2] * a[0] - c[0] * a[2], c[0] * a[1] - c[1] * a[0]};
+    const double ab[3] = {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    const double det = a[0] * bc[0] + a[1] * bc[1] + a[2] * bc[2];
+    if (det == 0.)
+      return false;
+
+    const double d[3] = {x - p0[0], y - p0[1], z - p0[2]};
+    for (int i = 0; i < 3; ++i)
+    {
+      grad[1][i] = bc[i] / det;
+      grad[2][i] = ca[i] / det;
+      grad[3][i] = ab[i] / det;
+      grad[0][i] = -(grad[1][i] + grad[2][i] + grad[3][i]);
+    }
+    t[1] = grad[1][0] * d[0] + grad[1][1] * d[1] + grad[1][2] * d[2];
+    t[2] = grad[2][0] * d[0] + grad[2][1] * d[1] + grad[2][2] * d[2];
+    t[3] = grad[3][0] * d[0] + grad[3][1] * d[1] + grad[3][2] * d[2];
+    t[0] = 1. - t[1] - t[2] - t[3];
+
+    const double tolerance = -1.e-10;
+    return t[0] >= tolerance && t[1] >= tolerance && t[2] >= tolerance && t[3] >= tolerance;
+  }
+
+  uint64_t Locate(double x, double y, double z, double t[4], double grad[4][3]) const
+  {
+    // Consecutive calls along a drift line usually land in the same element
+    if (lastMesh == mesh.get() && Barycentric(lastElement, x, y, z, t, grad))
+      return lastElement;
+
+    const double point[3] = {x, y, z};
+    uint64_t cell = 0;
+    for (int i = 2; i >= 0; --i)
+    {
+      if (point[i] < meshHeader->bbMin[i] || point[i] > meshHeader->bbMax[i])
+        return noElement;
+      uint64_t index = static_cast<uint64_t>((point[i] - meshHeader->bbMin[i]) / cellSize[i]);
+      index = std::min<uint64_t>(index, meshHeader->nCells[i] - 1);
+      cell = cell * meshHeader->nCells[i] + index;
+    }
+    // cell = (iz * ny + iy) * nx + ix
+
+    for (uint64_t k = cellStart[cell]; k < cellStart[cell + 1]; ++k)
+    {
+      const uint64_t element = cellEntries[k];
+      if (Barycentric(element, x, y, z, t, grad))
+      {
+        lastMesh = mesh.get();
+        lastElement = element;
+        return element;
+      }
+    }
+    return noElement;
+  }
+
+  std::shared_ptr<MappedFile> mesh;
+  std::shared_ptr<MappedFile> potentials;
+  const ComsolSnapshotFormat::MeshHeader *meshHeader = nullptr;
+  const ComsolSnapshotFormat::PotentialHeader *potentialHeader = nullptr;
+  const double *nodes = nullptr;
+  const uint32_t *elements = nullptr;
+  const uint32_t *elementMaterial = nullptr;
+  const uint32_t *driftMaterial = nullptr;
+  const uint64_t *cellStart = nullptr;
+  const uint32_t *cellEntries = nullptr;
+  const double *potential = nullptr;
+  double cellSize[3] = {0., 0., 0.};
+  Garfield::Medium *gas = nullptr;
+};
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef COMSOL_SNAPSHOT_WRITER_HH
+#define COMSOL_SNAPSHOT_WRITER_HH
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "comsol_snapshot.hh"
+
+/*
+Writes the binary snapshot read by ComsolSnapshot. Model is anything with the mesh accessors of Garfield's field maps
+(GetNumberOfNodes/Elements/Materials, GetNode, GetElement, GetPermittivity, ElectricField): a ComponentComsol in
+comsol_snapshot/make_snapshot.C, the synthetic drift cell in benchmark/make_benchmark_mesh.C.
+*/
+
+// Pads a stream to the next multiple of 8 bytes
+inline void AlignSnapshot(std::ofstream &out)
+{
+  static const char zeros[8] = {};
+  const auto position = static_cast<uint64_t>(out.tellp());
+  out.write(zeros, (8 - position % 8) % 8);
+}
+
+template <class T>
+uint64_t WriteSnapshotSection(std::ofstream &out, const std::vector<T> &data)
+{
+  AlignSnapshot(out);
+  const auto offset = static_cast<uint64_t>(out.tellp());
+  out.write(reinterpret_cast<const char *>(data.data()), data.size() * sizeof(T));
+  return offset;
+}
+
+template <class Model>
+bool WriteSnapshotMesh(Model &model, const std::string &fileName)
+{
+  using namespace ComsolSnapshotFormat;
+
+  MeshHeader header = {};
+  std::memcpy(header.magic, meshMagic, 8);
+  header.version = version;
+  header.nNodes = model.GetNumberOfNodes();
+  header.nElements = model.GetNumberOfElements();
+  header.nMaterials = model.GetNumberOfMaterials();
+
+  std::vector<double> nodes(3 * header.nNodes);
+  for (uint64_t i = 0; i < header.nNodes; ++i)
+  {
+    model.GetNode(i, nodes[3 * i], nodes[3 * i + 1], nodes[3 * i + 2]);
+  }
+  header.meshId = MeshId(nodes.data(), header.nNodes);
+
+  std::vector<uint32_t> elements(10 * header.nElements);
+  std::vector<uint32_t> elementMaterial(header.nElements);
+  std::vector<uint32_t> drift(header.nMaterials, 0);
+  std::vector<size_t> elementNodes;
+  for (uint64_t i = 0; i < header.nElements; ++i)
+  {
+    size_t material;
+    bool driftMedium;
+    if (!model.GetElement(i, material, driftMedium, elementNodes) || elementNodes.size() != 10)
+    {
+      std::cerr << "Element " << i << " is not a quadratic tetrahedron\n";
+      return false;
+    }
+    std::copy(elementNodes.begin(), elementNodes.end(), elements.begin() + 10 * i);
+    elementMaterial[i] = material;
+    if (driftMedium)
+      drift[material] = 1;
+  }
+
+  std::vector<double> permittivity(header.nMaterials);
+  for (uint32_t i = 0; i < header.nMaterials; ++i)
+  {
+    permittivity[i] = model.GetPermittivity(i);
+  }
+
+  // Bounding box of every element from its corner nodes
+  std::vector<double> boxes(6 * header.nElements);
+  for (int k = 0; k < 3; ++k)
+  {
+    header.bbMin[k] = std::numeric_limits<double>::max();
+    header.bbMax[k] = -std::numeric_limits<double>::max();
+  }
+  for (uint64_t i = 0; i < header.nElements; ++i)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      double lo = std::numeric_limits<double>::max();
+      double hi = -std::numeric_limits<double>::max();
+      for (int j = 0; j < 4; ++j)
+      {
+        double c = nodes[3 * elements[10 * i + j] + k];
+        lo = std::min(lo, c);
+        hi = std::max(hi, c);
+      }
+      boxes[6 * i + k] = lo;
+      boxes[6 * i + 3 + k] = hi;
+      header.bbMin[k] = std::min(header.bbMin[k], lo);
+      header.bbMax[k] = std::max(header.bbMax[k], hi);
+    }
+  }
+
+  // Bucket grid with about one cell per element, shaped like the bounding box
+  double extent[3], volume = 1.;
+  for (int k = 0; k < 3; ++k)
+  {
+    extent[k] = std::max(header.bbMax[k] - header.bbMin[k], 1.e-6);
+    volume *= extent[k];
+  }
+  const double cellSide = std::cbrt(volume / std::max<uint64_t>(header.nElements, 1));
+  double cellSize[3];
+  for (int k = 0; k < 3; ++k)
+  {
+    header.nCells[k] = std::clamp<uint32_t>(static_cast<uint32_t>(extent[k] / cellSide), 1, 1024);
+    cellSize[k] = extent[k] / header.nCells[k];
+  }
+  const uint64_t nCells = uint64_t(header.nCells[0]) * header.nCells[1] * header.nCells[2];
+
+  // Cells overlapped by an element's bounding box, as (ix, iy, iz) ranges
+  auto cell_range = [&](uint64_t i, uint32_t lo[3], uint32_t hi[3])
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      const double eps = 1.e-9 * extent[k];
+      lo[k] = std::min<uint32_t>(std::max(0., (boxes[6 * i + k] - eps - header.bbMin[k]) / cellSize[k]), header.nCells[k] - 1);
+      hi[k] = std::min<uint32_t>(std::max(0., (boxes[6 * i + 3 + k] + eps - header.bbMin[k]) / cellSize[k]), header.nCells[k] - 1);
+    }
+  };
+
+  std::vector<uint64_t> cellStart(nCells + 1, 0);
+  uint32_t lo[3], hi[3];
+  for (uint64_t i = 0; i < header.nElements; ++i)
+  {
+    cell_range(i, lo, hi);
+    for (uint32_t iz = lo[2]; iz <= hi[2]; ++iz)
+      for (uint32_t iy = lo[1]; iy <= hi[1]; ++iy)
+        for (uint32_t ix = lo[0]; ix <= hi[0]; ++ix)
+          cellStart[(uint64_t(iz) * header.nCells[1] + iy) * header.nCells[0] + ix + 1]++;
+  }
+  for (uint64_t c = 0; c < nCells; ++c)
+  {
+    cellStart[c + 1] += cellStart[c];
+  }
+  header.nCellEntries = cellStart[nCells];
+
+  std::vector<uint32_t> cellEntries(header.nCellEntries);
+  std::vector<uint64_t> fill(cellStart.begin(), cellStart.end() - 1);
+  for (uint64_t i = 0; i < header.nElements; ++i)
+  {
+    cell_range(i, lo, hi);
+    for (uint32_t iz = lo[2]; iz <= hi[2]; ++iz)
+      for (uint32_t iy = lo[1]; iy <= hi[1]; ++iy)
+        for (uint32_t ix = lo[0]; ix <= hi[0]; ++ix)
+          cellEntries[fill[(uint64_t(iz) * header.nCells[1] + iy) * header.nCells[0] + ix]++] = i;
+  }
+
+  std::ofstream out(fileName, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  header.nodesOffset = WriteSnapshotSection(out, nodes);
+  header.elementsOffset = WriteSnapshotSection(out, elements);
+  header.elementMaterialOffset = WriteSnapshotSection(out, elementMaterial);
+  header.permittivityOffset = WriteSnapshotSection(out, permittivity);
+  header.driftOffset = WriteSnapshotSection(out, drift);
+  header.cellStartOffset = WriteSnapshotSection(out, cellStart);
+  header.cellEntriesOffset = WriteSnapshotSection(out, cellEntries);
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.close();
+
+  std::cout << "Wrote " << fileName << ": " << header.nNodes << " nodes, " << header.nElements << " elements, "
+            << header.nCellEntries << " bucket entries\n";
+  return out.good();
+}
+
+template <class Model>
+bool WriteSnapshotPotential(Model &model, const std::string &fileName)
+{
+  using namespace ComsolSnapshotFormat;
+
+  PotentialHeader header = {};
+  std::memcpy(header.magic, potentialMagic, 8);
+  header.version = version;
+  header.nNodes = model.GetNumberOfNodes();
+
+  // Interpolating at a node gives back the value COMSOL exported for it. Where the element search of the model
+  // misses a node it returns 0 V without complaint, so such nodes fail the conversion instead of going in as 0.
+  std::vector<double> nodes(3 * header.nNodes);
+  std::vector<double> potential(header.nNodes);
+  uint64_t nMissed = 0;
+  for (uint64_t i = 0; i < header.nNodes; ++i)
+  {
+    double &x = nodes[3 * i], &y = nodes[3 * i + 1], &z = nodes[3 * i + 2];
+    model.GetNode(i, x, y, z);
+    double ex, ey, ez;
+    Garfield::Medium *m = nullptr;
+    int status = 0;
+    model.ElectricField(x, y, z, ex, ey, ez, potential[i], m, status);
+    if (status != 0 && status != -5) // -5: found, but not in the drift medium
+    {
+      if (nMissed < 10)
+        std::cerr << "Node " << i << " at (" << x << ", " << y << ", " << z << ") cm is in no element (status "
+                  << status << ")\n";
+      nMissed++;
+    }
+  }
+  if (nMissed > 0)
+  {
+    std::cerr << nMissed << " of " << header.nNodes << " nodes have no potential, not writing " << fileName << "\n";
+    return false;
+  }
+  header.meshId = MeshId(nodes.data(), header.nNodes);
+  header.vMin = *std::min_element(potential.begin(), potential.end());
+  header.vMax = *std::max_element(potential.begin(), potential.end());
+
+  std::ofstream out(fileName, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  header.potentialOffset = WriteSnapshotSection(out, potential);
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.close();
+
+  std::cout << "Wrote " << fileName << " (" << header.vMin << " V to " << header.vMax << " V)\n";
+  return out.good();
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef DRIFT_PROFILE_HH
+#define DRIFT_PROFILE_HH
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+/*
+Counters and timers for the drift hot path. Each drift thread points DriftProfile::current at its own DriftCounters;
+the components and the gas add to it, and nothing is counted on threads where it is null (one thread-local load and a
+branch per call). Only the owning thread writes a slot, so the updates are plain relaxed load/store pairs, yet another
+thread can read the counts of an electron that is still drifting (e.g. one stuck at a grid when the point times out).
+
+Timing a field or gas call reads the clock twice, which adds about 100 ns to a ~230 ns snapshot lookup, so it is off
+unless the thread sets DriftProfile::timingStride: the calls of one electron in timingStride are timed and stand in for
+the others. Whole electrons are sampled rather than single calls, since a lone timed call among untimed ones comes out
+slower than it is. The drift time of each electron is always taken (two clock reads per electron).
+
+Where things are counted:
+- field calls and field time: ScaledField, i.e. the component the sensor asks (common/scaled_field.hh)
+- interpolation failures: SafeField, whenever the model under it has no field
+- fallbacks: SafeField, each time it returns the last good field instead
+- gas calls and gas time: TimedMedium around the gas
+- drift time and RKF steps: DriftProfile::Electron around DriftElectron; integration time is what is left of the drift
+  time of the timed electrons after field and gas
+*/
+
+struct DriftCounts
+{
+  uint64_t electrons = 0;
+  uint64_t fieldCalls = 0;
+  uint64_t fieldFailures = 0;
+  uint64_t fallbacks = 0;
+  uint64_t gasCalls = 0;
+  uint64_t rkfSteps = 0;
+  uint64_t fieldNs = 0;
+  uint64_t gasNs = 0;
+  uint64_t driftNs = 0;
+  uint64_t timedDriftNs = 0; // drift time of the timed electrons, times the stride like fieldNs and gasNs
+
+  // Time in DriftLineRKF itself (steps, step size control, bookkeeping). Taken from the timed electrons, as their drift
+  // time includes the clock reads.
+  uint64_t IntegrationNs() const
+  {
+    return timedDriftNs > fieldNs + gasNs ? timedDriftNs - fieldNs - gasNs : 0;
+  }
+
+  DriftCounts operator-(const DriftCounts &o) const
+  {
+    return {electrons - o.electrons, fieldCalls - o.fieldCalls, fieldFailures - o.fieldFailures,
+            fallbacks - o.fallbacks, gasCalls - o.gasCalls, rkfSteps - o.rkfSteps, fieldNs - o.fieldNs,
+            gasNs - o.gasNs, driftNs - o.driftNs, timedDriftNs - o.timedDriftNs};
+  }
+
+  DriftCounts &operator+=(const DriftCounts &o)
+  {
+    electrons += o.electrons;
+    fieldCalls += o.fieldCalls;
+    fieldFailures += o.fieldFailures;
+    fallbacks += o.fallbacks;
+    gasCalls += o.gasCalls;
+    rkfSteps += o.rkfSteps;
+    fieldNs += o.fieldNs;
+    gasNs += o.gasNs;
+    driftNs += o.driftNs;
+    timedDriftNs += o.timedDriftNs;
+    return *this;
+  }
+};
+
+// Counters of one drift thread
+struct DriftCounters
+{
+  std::atomic<uint64_t> electrons{0};
+  std::atomic<uint64_t> fieldCalls{0};
+  std::atomic<uint64_t> fieldFailures{0};
+  std::atomic<uint64_t> fallbacks{0};
+  std::atomic<uint64_t> gasCalls{0};
+  std::atomic<uint64_t> rkfSteps{0};
+  std::atomic<uint64_t> fieldNs{0};
+  std::atomic<uint64_t> gasNs{0};
+  std::atomic<uint64_t> driftNs{0};
+  std::atomic<uint64_t> timedDriftNs{0};
+
+  // Electron being drifted (-1 when idle) and when it started
+  std::atomic<int64_t> electron{-1};
+  std::atomic<uint64_t> electronStartNs{0};
+
+  DriftCounts Read() const
+  {
+    constexpr auto r = std::memory_order_relaxed;
+    return {electrons.load(r), fieldCalls.load(r), fieldFailures.load(r), fallbacks.load(r), gasCalls.load(r),
+            rkfSteps.load(r), fieldNs.load(r), gasNs.load(r), driftNs.load(r), timedDriftNs.load(r)};
+  }
+};
+
+namespace DriftProfile
+{
+  inline thread_local DriftCounters *current = nullptr;
+
+  // Electrons whose field and gas calls are timed on this thread: one in timingStride (a power of two; 1 for every
+  // electron, 0 for none)
+  inline thread_local uint32_t timingStride = 0;
+  // Whether the electron being drifted on this thread is one of them
+  inline thread_local bool timing = false;
+
+  inline uint64_t Now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Single writer, so no read-modify-write instruction is needed
+  inline void Add(std::atomic<uint64_t> &counter, uint64_t n)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  inline void Count(std::atomic<uint64_t> DriftCounters::*counter, uint64_t n = 1)
+  {
+    if (current)
+      Add(current->*counter, n);
+  }
+
+  // Counts one call and, if the electron is timed, adds the time until the end of the scope times the stride. Does
+  // nothing (not even read the clock) when the thread is not profiled.
+  class ScopedTimer
+  {
+  public:
+    ScopedTimer(std::atomic<uint64_t> DriftCounters::*calls, std::atomic<uint64_t> DriftCounters::*ns)
+        : counters(current), ns(ns)
+    {
+      if (!counters)
+        return;
+      Add(counters->*calls, 1);
+      if (timing)
+      {
+        weight = timingStride;
+        start = Now();
+      }
+    }
+
+    ~ScopedTimer()
+    {
+      if (weight != 0)
+        Add(counters->*ns, (Now() - start) * weight);
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  private:
+    DriftCounters *counters;
+    std::atomic<uint64_t> DriftCounters::*ns;
+    uint64_t weight = 0;
+    uint64_t start = 0;
+  };
+
+  // Brackets the drift of one electron: marks it as in flight and gives back what it cost. Its field and gas times are
+  // zero unless it was one of the timed electrons.
+  class Electron
+  {
+  public:
+    explicit Electron(int64_t electron) : counters(current)
+    {
+      if (!counters)
+        return;
+      before = counters->Read();
+      timing = timingStride != 0 && (before.electrons & (timingStride - 1)) == 0;
+      start = Now();
+      counters->electronStartNs.store(start, std::memory_order_relaxed);
+      counters->electron.store(electron, std::memory_order_relaxed);
+    }
+
+    // Call once the drift line is done; rkfSteps is its number of steps
+    DriftCounts Finish(uint64_t rkfSteps)
+    {
+      if (!counters)
+        return {};
+      const uint64_t ns = Now() - start;
+      Add(counters->driftNs, ns);
+      if (timing)
+        Add(counters->timedDriftNs, ns * timingStride);
+      Add(counters->rkfSteps, rkfSteps);
+      Add(counters->electrons, 1);
+      counters->electron.store(-1, std::memory_order_relaxed);
+      DriftCounts cost = counters->Read() - before;
+      if (timing)
+      {
+        // The totals take the times times the stride, this electron only its own
+        cost.fieldNs /= timingStride;
+        cost.gasNs /= timingStride;
+        cost.timedDriftNs /= timingStride;
+        timing = false;
+      }
+      return cost;
+    }
+
+  private:
+    DriftCounters *counters;
+    DriftCounts before;
+    uint64_t start = 0;
+  };
+}
+
+// Gas whose transport lookups are counted and timed, e.g. TimedMedium<Garfield::MediumMagboltz>
+template <class Base>
+class TimedMedium : public Base
+{
+public:
+  using Base::Base;
+  using Base::ElectronDiffusion;
+
+  bool ElectronVelocity(const double ex, const double ey, const double ez,
+                        const double bx, const double by, const double bz,
+                        double &vx, double &vy, double &vz) override
+  {
+    DriftProfile::ScopedTimer timer(&DriftCounters::gasCalls, &DriftCounters::gasNs);
+    return Base::ElectronVelocity(ex, ey, ez, bx, by, bz, vx, vy, vz);
+  }
+
+  bool ElectronDiffusion(const double ex, const double ey, const double ez,
+                         const double bx, const double by, const double bz,
+                         double &dl, double &dt) override
+  {
+    DriftProfile::ScopedTimer timer(&DriftCounters::gasCalls, &DriftCounters::gasNs);
+    return Base::ElectronDiffusion(ex, ey, ez, bx, by, bz, dl, dt);
+  }
+
+  bool ElectronTownsend(const double ex, const double ey, const double ez,
+                        const double bx, const double by, const double bz, double &alpha) override
+  {
+    DriftProfile::ScopedTimer timer(&DriftCounters::gasCalls, &DriftCounters::gasNs);
+    return Base::ElectronTownsend(ex, ey, ez, bx, by, bz, alpha);
+  }
+
+  bool ElectronAttachment(const double ex, const double ey, const double ez,
+                          const double bx, const double by, const double bz, double &eta) override
+  {
+    DriftProfile::ScopedTimer timer(&DriftCounters::gasCalls, &DriftCounters::gasNs);
+    return Base::ElectronAttachment(ex, ey, ez, bx, by, bz, eta);
+  }
+};
+
+#endif
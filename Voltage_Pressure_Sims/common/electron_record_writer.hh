@@ -0,0 +1,189 @@
+#ifndef ELECTRON_RECORD_WRITER_HH
+#define ELECTRON_RECORD_WRITER_HH
+
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+Streams one record per drifted electron to a chunked columnar file, keeping only one chunk in memory. Layout (all
+little-endian):
+
+  file header   "PUMAELEC", uint32 version, uint32 nColumns, uint32 chunkCapacity, 12 bytes reserved
+  columns       nColumns x {char name[16], char dtype[8] (numpy style, e.g. "<f8"), 8 bytes reserved}
+  chunks        "CHNK", uint32 nRecords, 8 bytes reserved, then each column as nRecords values, padded to 8 bytes
+
+Every chunk is written with a single write, so a killed run leaves only whole chunks (plus at most one cut-off chunk
+the reader ignores). speed_distribution_analysis/electron_records.py maps the file and returns numpy views of the
+columns without copying.
+*/
+
+struct ElectronRecord
+{
+  int64_t electron = 0; // index of the electron within its run
+  double x0 = 0., y0 = 0., z0 = 0., t0 = 0.; // start [cm, ns]
+  double x1 = 0., y1 = 0., z1 = 0., t1 = 0.; // end point [cm, ns]
+  double pathLength = 0.;                    // length of the drift line [cm]
+  // Hot-path counts for this electron (common/drift_profile.hh); zero when the run is not profiled
+  int64_t fieldCalls = 0, fieldFailures = 0, fallbacks = 0, gasCalls = 0;
+  double fieldTime = 0., gasTime = 0., driftTime = 0.; // [us]; field and gas only for timed electrons
+  int32_t status = 0;                        // end status from DriftLineRKF
+  int32_t nSteps = 0;                        // RKF steps along the drift line
+};
+
+// Fills the end point, path length and step count of a record from a finished drift line (DriftLineRKF)
+template <class Drift>
+void FillDriftLine(const Drift &drift, ElectronRecord &record)
+{
+  drift.GetEndPoint(record.x1, record.y1, record.z1, record.t1, record.status);
+  const size_t nPoints = drift.GetNumberOfDriftLinePoints();
+  record.nSteps = nPoints > 0 ? nPoints - 1 : 0;
+  record.pathLength = 0.;
+  double xPrev = 0., yPrev = 0., zPrev = 0., t = 0.;
+  for (size_t i = 0; i < nPoints; ++i)
+  {
+    double x, y, z;
+    drift.GetDriftLinePoint(i, x, y, z, t);
+    if (i > 0)
+      record.pathLength += std::sqrt((x - xPrev) * (x - xPrev) + (y - yPrev) * (y - yPrev) + (z - zPrev) * (z - zPrev));
+    xPrev = x;
+    yPrev = y;
+    zPrev = z;
+  }
+}
+
+class ElectronRecordWriter
+{
+public:
+  explicit ElectronRecordWriter(uint32_t chunkCapacity = 4096) : chunkCapacity(chunkCapacity)
+  {
+    buffer.reserve(chunkCapacity);
+  }
+
+  ~ElectronRecordWriter() { Close(); }
+
+  ElectronRecordWriter(const ElectronRecordWriter &) = delete;
+  ElectronRecordWriter &operator=(const ElectronRecordWriter &) = delete;
+
+  bool Open(const std::string &fileName)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+
+    std::vector<char> header(32 + 32 * columns.size(), 0);
+    const uint32_t fields[3] = {version, static_cast<uint32_t>(columns.size()), chunkCapacity};
+    std::memcpy(header.data(), "PUMAELEC", 8);
+    std::memcpy(header.data() + 8, fields, sizeof(fields));
+    for (size_t c = 0; c < columns.size(); ++c)
+    {
+      std::strncpy(header.data() + 32 + 32 * c, columns[c].name, 15);
+      std::strncpy(header.data() + 32 + 32 * c + 16, columns[c].dtype, 7);
+    }
+    return WriteAll(header.data(), header.size());
+  }
+
+  // Safe to call from several drift threads; does nothing once the file is closed
+  void Add(const ElectronRecord &record)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0)
+      return;
+    buffer.push_back(record);
+    if (buffer.size() >= chunkCapacity)
+      Flush();
+  }
+
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0)
+      return;
+    Flush();
+    close(fd);
+    fd = -1;
+  }
+
+private:
+  struct Column
+  {
+    const char *name;
+    const char *dtype;
+    size_t offset; // within ElectronRecord
+    size_t size;
+  };
+
+  static inline const std::vector<Column> columns = {
+      {"electron", "<i8", offsetof(ElectronRecord, electron), 8},
+      {"x0", "<f8", offsetof(ElectronRecord, x0), 8},
+      {"y0", "<f8", offsetof(ElectronRecord, y0), 8},
+      {"z0", "<f8", offsetof(ElectronRecord, z0), 8},
+      {"t0", "<f8", offsetof(ElectronRecord, t0), 8},
+      {"x1", "<f8", offsetof(ElectronRecord, x1), 8},
+      {"y1", "<f8", offsetof(ElectronRecord, y1), 8},
+      {"z1", "<f8", offsetof(ElectronRecord, z1), 8},
+      {"t1", "<f8", offsetof(ElectronRecord, t1), 8},
+      {"path_length", "<f8", offsetof(ElectronRecord, pathLength), 8},
+      {"status", "<i4", offsetof(ElectronRecord, status), 4},
+      {"n_steps", "<i4", offsetof(ElectronRecord, nSteps), 4},
+      {"field_calls", "<i8", offsetof(ElectronRecord, fieldCalls), 8},
+      {"field_failures", "<i8", offsetof(ElectronRecord, fieldFailures), 8},
+      {"fallbacks", "<i8", offsetof(ElectronRecord, fallbacks), 8},
+      {"gas_calls", "<i8", offsetof(ElectronRecord, gasCalls), 8},
+      {"field_time", "<f8", offsetof(ElectronRecord, fieldTime), 8},
+      {"gas_time", "<f8", offsetof(ElectronRecord, gasTime), 8},
+      {"drift_time", "<f8", offsetof(ElectronRecord, driftTime), 8}};
+
+  static constexpr uint32_t version = 1;
+
+  // Writes the buffered records as one chunk, column after column
+  void Flush()
+  {
+    if (buffer.empty())
+      return;
+    const uint32_t n = buffer.size();
+    chunk.assign(16, 0);
+    std::memcpy(chunk.data(), "CHNK", 4);
+    std::memcpy(chunk.data() + 4, &n, 4);
+    for (const auto &column : columns)
+    {
+      const size_t start = chunk.size();
+      chunk.resize(start + (n * column.size + 7) / 8 * 8, 0);
+      for (uint32_t i = 0; i < n; ++i)
+      {
+        std::memcpy(chunk.data() + start + i * column.size,
+                    reinterpret_cast<const char *>(&buffer[i]) + column.offset, column.size);
+      }
+    }
+    WriteAll(chunk.data(), chunk.size());
+    buffer.clear();
+  }
+
+  bool WriteAll(const char *data, size_t size)
+  {
+    while (size > 0)
+    {
+      ssize_t written = write(fd, data, size);
+      if (written <= 0)
+        return false;
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  std::mutex mutex;
+  int fd = -1;
+  uint32_t chunkCapacity;
+  std::vector<ElectronRecord> buffer;
+  std::vector<char> chunk;
+};
+
+#endif
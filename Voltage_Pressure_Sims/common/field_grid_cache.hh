@@ -0,0 +1,452 @@
+#ifndef FIELD_GRID_CACHE_HH
+#define FIELD_GRID_CACHE_HH
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Garfield/Component.hh"
+#include "Garfield/ComponentComsol.hh"
+#include "Garfield/MediumMagboltz.hh"
+
+#include "comsol_snapshot.hh"
+
+/*
+Precomputed field on a regular grid, to avoid searching the FEM mesh on every RKF step. The model is sampled once on a
+coarse grid; cells where trilinear interpolation misses the field at the cell centre, or that straddle an electrode, get
+a finer sub-grid. Lookups inside the box are pure trilinear interpolation and never touch the mesh. Points outside the
+box are passed on to the model.
+
+Nodes of the coarse grid and of all sub-grids live in one structure-of-arrays (ex, ey, ez, v, valid), so that the batch
+lookup is two flat loops the compiler can vectorize: one computing node offsets and weights, one gathering and blending.
+efield_study/field_cache_report.C measures the accuracy and speed against the model itself.
+*/
+
+// Field of the model without any fallback, so that points inside electrodes can be told apart
+inline void RawField(Garfield::Component *model, double x, double y, double z,
+                     double &ex, double &ey, double &ez, double &v, int &status)
+{
+  Garfield::Medium *m = nullptr;
+  model->ElectricField(x, y, z, ex, ey, ez, v, m, status);
+}
+
+inline void RawField(Garfield::ComponentComsol *model, double x, double y, double z,
+                     double &ex, double &ey, double &ez, double &v, int &status)
+{
+  Garfield::Medium *m = nullptr;
+  model->ComponentComsol::ElectricField(x, y, z, ex, ey, ez, v, m, status);
+}
+
+inline void RawField(ComsolSnapshot *model, double x, double y, double z,
+                     double &ex, double &ey, double &ez, double &v, int &status)
+{
+  Garfield::Medium *m = nullptr;
+  model->Evaluate(x, y, z, ex, ey, ez, v, m, status);
+}
+
+template <class Model>
+class FieldGridCache : public Garfield::Component
+{
+public:
+  explicit FieldGridCache(Model *model) : Component("FieldGridCache"), model(model) {}
+
+  /*
+  Samples the model over the box with the given node spacing [cm]. A cell is refined by the given factor when
+  trilinear interpolation is off by more than tolerance at its centre (relative to the larger of the local and the
+  mean field) or when some of its corners are inside an electrode.
+  */
+  void Build(double xmin, double ymin, double zmin, double xmax, double ymax, double zmax,
+             double spacing, double tolerance = 1e-3, int refinement = 4,
+             int nThreads = std::max(1u, std::thread::hardware_concurrency()))
+  {
+    m_ready = false;
+    lo[0] = xmin;
+    lo[1] = ymin;
+    lo[2] = zmin;
+    hi[0] = xmax;
+    hi[1] = ymax;
+    hi[2] = zmax;
+    for (int i = 0; i < 3; ++i)
+    {
+      nCells[i] = std::max(1, static_cast<int>(std::ceil((hi[i] - lo[i]) / spacing)));
+      step[i] = (hi[i] - lo[i]) / nCells[i];
+    }
+    factor = std::max(2, refinement);
+    blockSide = factor + 1;
+
+    // The drift regions are only known once the model has a gas; any gas will do
+    model->SetGas(&placeholder);
+
+    // Coarse grid
+    const size_t nx = nCells[0] + 1, ny = nCells[1] + 1, nz = nCells[2] + 1;
+    nCoarse = nx * ny * nz;
+    Resize(nCoarse);
+    Parallel(nz, nThreads, [&](size_t iz)
+             {
+      for (size_t iy = 0; iy < ny; ++iy)
+        for (size_t ix = 0; ix < nx; ++ix)
+          Sample((iz * ny + iy) * nx + ix, lo[0] + ix * step[0], lo[1] + iy * step[1], lo[2] + iz * step[2]); });
+
+    double meanField = 0.;
+    size_t nValid = 0;
+    for (size_t i = 0; i < nCoarse; ++i)
+    {
+      if (nodeValid[i])
+      {
+        meanField += std::sqrt(double(nodeEx[i]) * nodeEx[i] + double(nodeEy[i]) * nodeEy[i] + double(nodeEz[i]) * nodeEz[i]);
+        nValid++;
+      }
+    }
+    meanField = nValid > 0 ? meanField / nValid : 1.;
+
+    // Pick the cells to refine by comparing the model and the interpolation at the cell centres
+    const size_t nCellsTotal = size_t(nCells[0]) * nCells[1] * nCells[2];
+    std::vector<uint8_t> refine(nCellsTotal, 0);
+    Parallel(nCells[2], nThreads, [&](size_t iz)
+             {
+      for (int iy = 0; iy < nCells[1]; ++iy)
+      {
+        for (int ix = 0; ix < nCells[0]; ++ix)
+        {
+          const size_t cell = (iz * nCells[1] + iy) * nCells[0] + ix;
+          const size_t n0 = (iz * ny + iy) * nx + ix;
+          int nCornersValid = 0;
+          for (int c = 0; c < 8; ++c)
+            nCornersValid += nodeValid[n0 + (c & 1) + ((c >> 1) & 1) * nx + ((c >> 2) & 1) * nx * ny];
+          if (nCornersValid == 0)
+            continue;
+          if (nCornersValid < 8)
+          {
+            refine[cell] = 1;
+            continue;
+          }
+
+          double fx, fy, fz, fv;
+          int status;
+          RawField(model, lo[0] + (ix + 0.5) * step[0], lo[1] + (iy + 0.5) * step[1], lo[2] + (iz + 0.5) * step[2],
+                   fx, fy, fz, fv, status);
+          if (status != 0)
+          {
+            refine[cell] = 1;
+            continue;
+          }
+          double cx = 0., cy = 0., cz = 0.;
+          for (int c = 0; c < 8; ++c)
+          {
+            const size_t n = n0 + (c & 1) + ((c >> 1) & 1) * nx + ((c >> 2) & 1) * nx * ny;
+            cx += 0.125 * nodeEx[n];
+            cy += 0.125 * nodeEy[n];
+            cz += 0.125 * nodeEz[n];
+          }
+          const double error = std::sqrt((cx - fx) * (cx - fx) + (cy - fy) * (cy - fy) + (cz - fz) * (cz - fz));
+          const double scale = std::max(std::sqrt(fx * fx + fy * fy + fz * fz), meanField);
+          refine[cell] = error > tolerance * scale;
+        }
+      } });
+
+    // Sub-grids for the refined cells, appended after the coarse nodes
+    block.assign(nCellsTotal, -1);
+    std::vector<size_t> refined;
+    for (size_t cell = 0; cell < nCellsTotal; ++cell)
+    {
+      if (refine[cell])
+      {
+        block[cell] = static_cast<int64_t>(nCoarse + refined.size() * blockSide * blockSide * blockSide);
+        refined.push_back(cell);
+      }
+    }
+    nRefined = refined.size();
+    Resize(nCoarse + nRefined * blockSide * blockSide * blockSide);
+    Parallel(nRefined, nThreads, [&](size_t b)
+             {
+      const size_t cell = refined[b];
+      const size_t ix = cell % nCells[0], iy = (cell / nCells[0]) % nCells[1], iz = cell / (size_t(nCells[0]) * nCells[1]);
+      const size_t offset = block[cell];
+      for (int jz = 0; jz < blockSide; ++jz)
+        for (int jy = 0; jy < blockSide; ++jy)
+          for (int jx = 0; jx < blockSide; ++jx)
+            Sample(offset + (jz * blockSide + jy) * blockSide + jx,
+                   lo[0] + (ix + double(jx) / factor) * step[0],
+                   lo[1] + (iy + double(jy) / factor) * step[1],
+                   lo[2] + (iz + double(jz) / factor) * step[2]); });
+
+    FillInvalid();
+    m_ready = true;
+
+    std::cout << "Field cache: " << nCoarse << " coarse nodes, " << nRefined << " of " << nCellsTotal
+              << " cells refined x" << factor << ", " << GetMemoryUsage() / (1024. * 1024.) << " MB\n";
+  }
+
+  // The gas is returned for points in the drift regions and passed on to the model for points outside the box
+  void SetGas(Garfield::Medium *m)
+  {
+    gas = m;
+    model->SetGas(m);
+  }
+
+  using Component::ElectricField;
+
+  void ElectricField(const double x, const double y, const double z,
+                     double &ex, double &ey, double &ez, Garfield::Medium *&m, int &status) override
+  {
+    double v = 0.;
+    ElectricField(x, y, z, ex, ey, ez, v, m, status);
+  }
+
+  void ElectricField(const double x, const double y, const double z,
+                     double &ex, double &ey, double &ez, double &v,
+                     Garfield::Medium *&m, int &status) override
+  {
+    if (!Inside(x, y, z))
+    {
+      model->ElectricField(x, y, z, ex, ey, ez, v, m, status);
+      return;
+    }
+    ElectricFieldBatch(1, &x, &y, &z, &ex, &ey, &ez, &v, &status);
+    m = status == 0 ? gas : nullptr;
+  }
+
+  // Field at n points, all of which must be inside the box. Status is 0 in the drift medium and -5 in electrodes.
+  void ElectricFieldBatch(size_t n, const double *x, const double *y, const double *z,
+                          double *fx, double *fy, double *fz, double *fv, int *status) const
+  {
+    constexpr size_t chunk = 256;
+    int64_t base[chunk], sx[chunk], sy[chunk], sz[chunk];
+    double tx[chunk], ty[chunk], tz[chunk];
+
+    for (size_t start = 0; start < n; start += chunk)
+    {
+      const size_t count = std::min(chunk, n - start);
+
+      // Pass 1: cell, sub-cell and local coordinates of every point
+      for (size_t k = 0; k < count; ++k)
+      {
+        const double u[3] = {(x[start + k] - lo[0]) / step[0], (y[start + k] - lo[1]) / step[1], (z[start + k] - lo[2]) / step[2]};
+        int64_t i[3];
+        double t[3];
+        for (int d = 0; d < 3; ++d)
+        {
+          i[d] = std::min<int64_t>(std::max<int64_t>(static_cast<int64_t>(u[d]), 0), nCells[d] - 1);
+          t[d] = u[d] - i[d];
+        }
+        const int64_t offset = block[(i[2] * nCells[1] + i[1]) * nCells[0] + i[0]];
+        if (offset < 0)
+        {
+          const int64_t nx = nCells[0] + 1, ny = nCells[1] + 1;
+          base[k] = (i[2] * ny + i[1]) * nx + i[0];
+          sx[k] = 1;
+          sy[k] = nx;
+          sz[k] = nx * ny;
+        }
+        else
+        {
+          int64_t j[3];
+          for (int d = 0; d < 3; ++d)
+          {
+            const double s = t[d] * factor;
+            j[d] = std::min<int64_t>(static_cast<int64_t>(s), factor - 1);
+            t[d] = s - j[d];
+          }
+          base[k] = offset + (j[2] * blockSide + j[1]) * blockSide + j[0];
+          sx[k] = 1;
+          sy[k] = blockSide;
+          sz[k] = blockSide * blockSide;
+        }
+        tx[k] = t[0];
+        ty[k] = t[1];
+        tz[k] = t[2];
+      }
+
+      // Pass 2: trilinear blend of the eight corners
+      for (size_t k = 0; k < count; ++k)
+      {
+        const int64_t n000 = base[k], n100 = n000 + sx[k], n010 = n000 + sy[k], n110 = n010 + sx[k];
+        const int64_t n001 = n000 + sz[k], n101 = n001 + sx[k], n011 = n001 + sy[k], n111 = n011 + sx[k];
+        const double ax = 1. - tx[k], ay = 1. - ty[k], az = 1. - tz[k];
+        const double w000 = ax * ay * az, w100 = tx[k] * ay * az, w010 = ax * ty[k] * az, w110 = tx[k] * ty[k] * az;
+        const double w001 = ax * ay * tz[k], w101 = tx[k] * ay * tz[k], w011 = ax * ty[k] * tz[k], w111 = tx[k] * ty[k] * tz[k];
+        fx[start + k] = w000 * nodeEx[n000] + w100 * nodeEx[n100] + w010 * nodeEx[n010] + w110 * nodeEx[n110] +
+                        w001 * nodeEx[n001] + w101 * nodeEx[n101] + w011 * nodeEx[n011] + w111 * nodeEx[n111];
+        fy[start + k] = w000 * nodeEy[n000] + w100 * nodeEy[n100] + w010 * nodeEy[n010] + w110 * nodeEy[n110] +
+                        w001 * nodeEy[n001] + w101 * nodeEy[n101] + w011 * nodeEy[n011] + w111 * nodeEy[n111];
+        fz[start + k] = w000 * nodeEz[n000] + w100 * nodeEz[n100] + w010 * nodeEz[n010] + w110 * nodeEz[n110] +
+                        w001 * nodeEz[n001] + w101 * nodeEz[n101] + w011 * nodeEz[n011] + w111 * nodeEz[n111];
+        fv[start + k] = w000 * nodeV[n000] + w100 * nodeV[n100] + w010 * nodeV[n010] + w110 * nodeV[n110] +
+                        w001 * nodeV[n001] + w101 * nodeV[n101] + w011 * nodeV[n011] + w111 * nodeV[n111];
+        // The nearest corner decides whether the point is in the gas or in an electrode
+        const int64_t nearest = n000 + (tx[k] >= 0.5) * sx[k] + (ty[k] >= 0.5) * sy[k] + (tz[k] >= 0.5) * sz[k];
+        status[start + k] = nodeValid[nearest] ? 0 : -5;
+      }
+    }
+  }
+
+  double ElectricPotential(const double x, const double y, const double z) override
+  {
+    double ex, ey, ez, v;
+    Garfield::Medium *m;
+    int status;
+    ElectricField(x, y, z, ex, ey, ez, v, m, status);
+    return v;
+  }
+
+  Garfield::Medium *GetMedium(const double x, const double y, const double z) override
+  {
+    double ex, ey, ez, v;
+    Garfield::Medium *m;
+    int status;
+    ElectricField(x, y, z, ex, ey, ez, v, m, status);
+    return m;
+  }
+
+  bool GetVoltageRange(double &vmin, double &vmax) override { return model->GetVoltageRange(vmin, vmax); }
+
+  bool GetBoundingBox(double &xmin, double &ymin, double &zmin,
+                      double &xmax, double &ymax, double &zmax) override
+  {
+    return model->GetBoundingBox(xmin, ymin, zmin, xmax, ymax, zmax);
+  }
+
+  bool Inside(double x, double y, double z) const
+  {
+    return m_ready && x >= lo[0] && x <= hi[0] && y >= lo[1] && y <= hi[1] && z >= lo[2] && z <= hi[2];
+  }
+
+  size_t GetNumberOfNodes() const { return nodeEx.size(); }
+  size_t GetNumberOfRefinedCells() const { return nRefined; }
+  size_t GetMemoryUsage() const { return nodeEx.size() * (4 * sizeof(float) + 1) + block.size() * sizeof(int64_t); }
+
+private:
+  // Pure virtual in Garfield::Component; the grid is only rebuilt by Build
+  void Reset() override {}
+  void UpdatePeriodicity() override {}
+
+  void Resize(size_t n)
+  {
+    nodeEx.resize(n);
+    nodeEy.resize(n);
+    nodeEz.resize(n);
+    nodeV.resize(n);
+    nodeValid.resize(n);
+  }
+
+  void Sample(size_t node, double x, double y, double z)
+  {
+    double fx, fy, fz, fv;
+    int status;
+    RawField(model, x, y, z, fx, fy, fz, fv, status);
+    nodeEx[node] = fx;
+    nodeEy[node] = fy;
+    nodeEz[node] = fz;
+    nodeV[node] = fv;
+    nodeValid[node] = status == 0;
+  }
+
+  // Nodes inside electrodes take the mean of their valid neighbours, so that cells touching an electrode interpolate
+  // towards the field at its surface instead of towards zero
+  void FillInvalid()
+  {
+    const int64_t nx = nCells[0] + 1, ny = nCells[1] + 1, nz = nCells[2] + 1;
+    std::vector<uint8_t> known(nodeValid);
+    auto fill = [&](int64_t node, const int64_t *neighbours, int nNeighbours)
+    {
+      double sum[4] = {0., 0., 0., 0.};
+      int nKnown = 0;
+      for (int k = 0; k < nNeighbours; ++k)
+      {
+        const int64_t n = neighbours[k];
+        if (n < 0 || !known[n])
+          continue;
+        sum[0] += nodeEx[n];
+        sum[1] += nodeEy[n];
+        sum[2] += nodeEz[n];
+        sum[3] += nodeV[n];
+        nKnown++;
+      }
+      if (nKnown == 0)
+        return false;
+      nodeEx[node] = sum[0] / nKnown;
+      nodeEy[node] = sum[1] / nKnown;
+      nodeEz[node] = sum[2] / nKnown;
+      nodeV[node] = sum[3] / nKnown;
+      return true;
+    };
+
+    for (int pass = 0; pass < 3; ++pass)
+    {
+      std::vector<int64_t> filled;
+      for (int64_t iz = 0; iz < nz; ++iz)
+        for (int64_t iy = 0; iy < ny; ++iy)
+          for (int64_t ix = 0; ix < nx; ++ix)
+          {
+            const int64_t node = (iz * ny + iy) * nx + ix;
+            if (known[node])
+              continue;
+            const int64_t neighbours[6] = {ix > 0 ? node - 1 : -1, ix < nx - 1 ? node + 1 : -1,
+                                           iy > 0 ? node - nx : -1, iy < ny - 1 ? node + nx : -1,
+                                           iz > 0 ? node - nx * ny : -1, iz < nz - 1 ? node + nx * ny : -1};
+            if (fill(node, neighbours, 6))
+              filled.push_back(node);
+          }
+      for (size_t cell = 0; cell < block.size(); ++cell)
+      {
+        if (block[cell] < 0)
+          continue;
+        const int64_t offset = block[cell], s = blockSide;
+        for (int64_t jz = 0; jz < s; ++jz)
+          for (int64_t jy = 0; jy < s; ++jy)
+            for (int64_t jx = 0; jx < s; ++jx)
+            {
+              const int64_t node = offset + (jz * s + jy) * s + jx;
+              if (known[node])
+                continue;
+              const int64_t neighbours[6] = {jx > 0 ? node - 1 : -1, jx < s - 1 ? node + 1 : -1,
+                                             jy > 0 ? node - s : -1, jy < s - 1 ? node + s : -1,
+                                             jz > 0 ? node - s * s : -1, jz < s - 1 ? node + s * s : -1};
+              if (fill(node, neighbours, 6))
+                filled.push_back(node);
+            }
+      }
+      if (filled.empty())
+        break;
+      for (int64_t node : filled)
+        known[node] = 1;
+    }
+  }
+
+  template <class Function>
+  static void Parallel(size_t n, int nThreads, Function function)
+  {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; ++t)
+    {
+      threads.emplace_back([&, t]()
+                           {
+        for (size_t i = t; i < n; i += nThreads)
+          function(i); });
+    }
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  Model *model;
+  Garfield::MediumMagboltz placeholder;
+  Garfield::Medium *gas = nullptr;
+
+  double lo[3] = {0., 0., 0.};
+  double hi[3] = {0., 0., 0.};
+  double step[3] = {1., 1., 1.};
+  int nCells[3] = {1, 1, 1};
+  int factor = 4;
+  int blockSide = 5;
+  size_t nCoarse = 0;
+  size_t nRefined = 0;
+
+  std::vector<int64_t> block; // per coarse cell: first node of its sub-grid, or -1
+  std::vector<float> nodeEx, nodeEy, nodeEz, nodeV;
+  std::vector<uint8_t> nodeValid; // 1 if the node is in the drift medium
+};
+
+#endif
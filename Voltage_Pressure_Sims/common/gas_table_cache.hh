@@ -0,0 +1,54 @@
+#ifndef GAS_TABLE_CACHE_HH
+#define GAS_TABLE_CACHE_HH
+
+#include <cstdio>
+#include <string>
+#include <filesystem>
+
+#include "Garfield/MediumMagboltz.hh"
+
+/*
+On-disk cache of Magboltz gas tables, one file per (gas, pressure, temperature, electron energy limit). The tables are
+made by gas_tables/build_gas_tables.C; the simulations only look them up and never run Magboltz themselves.
+*/
+
+struct GasKey
+{
+  std::string gas;          // Garfield gas name, 100% of the mixture (e.g. "Xe", "Ar")
+  double pressure;          // [Torr]
+  double temperature;       // [K]
+  double maxElectronEnergy; // [eV]; 0 means Magboltz picks the limit itself
+};
+
+inline std::string GasTableFileName(const std::string &cacheDir, const GasKey &key)
+{
+  char name[256];
+  if (key.maxElectronEnergy > 0.)
+    std::snprintf(name, sizeof(name), "%s_%.3fTorr_%.2fK_%geV.gas", key.gas.c_str(), key.pressure, key.temperature,
+                  key.maxElectronEnergy);
+  else
+    std::snprintf(name, sizeof(name), "%s_%.3fTorr_%.2fK_auto.gas", key.gas.c_str(), key.pressure, key.temperature);
+  return (std::filesystem::path(cacheDir) / name).string();
+}
+
+// Sets up a gas for the conditions of a key, as the tables in the cache were generated
+inline void ConfigureGas(Garfield::MediumMagboltz &gas, const GasKey &key)
+{
+  gas.SetComposition(key.gas, 100.);
+  gas.SetTemperature(key.temperature);
+  gas.SetPressure(key.pressure);
+  if (key.maxElectronEnergy > 0.)
+  {
+    gas.SetMaxElectronEnergy(key.maxElectronEnergy);
+    gas.EnableAutoEnergyLimit(false);
+  }
+}
+
+// Loads the cached table for a key. Returns false if it has not been generated yet.
+inline bool LoadCachedGasTable(Garfield::MediumMagboltz &gas, const std::string &cacheDir, const GasKey &key)
+{
+  const std::string fileName = GasTableFileName(cacheDir, key);
+  return std::filesystem::exists(fileName) && gas.LoadGasFile(fileName);
+}
+
+#endif
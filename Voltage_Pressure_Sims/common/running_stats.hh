@@ -0,0 +1,47 @@
+#ifndef RUNNING_STATS_HH
+#define RUNNING_STATS_HH
+
+#include <cmath>
+#include <limits>
+
+/*
+Streaming mean and variance (Welford's update), so a run can check the standard error of its estimate after every
+electron without keeping the samples. Numerically stable even when the spread is ~0.1% of the mean.
+*/
+
+class RunningStats
+{
+public:
+  void Add(double x)
+  {
+    ++n;
+    const double delta = x - mean;
+    mean += delta / n;
+    m2 += delta * (x - mean);
+  }
+
+  long long Count() const { return n; }
+  double Mean() const { return mean; }
+
+  // Sample variance (n - 1 in the denominator)
+  double Variance() const { return n > 1 ? m2 / (n - 1) : 0.; }
+  double StdDev() const { return std::sqrt(Variance()); }
+
+  // Standard error of the mean
+  double StdError() const { return n > 1 ? StdDev() / std::sqrt(static_cast<double>(n)) : 0.; }
+
+  // Standard error relative to the mean; infinite until there is something to compare
+  double RelativeError() const
+  {
+    if (n < 2 || mean == 0.)
+      return std::numeric_limits<double>::infinity();
+    return StdError() / std::fabs(mean);
+  }
+
+private:
+  long long n = 0;
+  double mean = 0.;
+  double m2 = 0.;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef SAFE_FIELD_HH
+#define SAFE_FIELD_HH
+
+#include <cstdint>
+#include <atomic>
+#include <unordered_map>
+
+#include "Garfield/Component.hh"
+#include "Garfield/Medium.hh"
+
+#include "drift_profile.hh"
+
+/*
+Used to improve handling of cases where COMSOL interpolation fails: where the model has no field (status != 0, e.g.
+inside a grid wire or where the element search misses), SafeField hands back the last good field instead, so the
+electron keeps drifting. This is the "less correct approach" the drift speed CSVs of drift_sim/e_drift_sim.C were made
+with. It is opt-in: the models themselves (ComponentComsol, ComsolSnapshot, FieldGridCache) return the failure.
+
+Model is any component with SetGas. The last good field is kept per SafeField and per thread, so drift threads sharing
+one SafeField never get each other's field, and neither do two SafeFields used on the same thread. It is also kept per
+electron: call SafeFieldNewElectron() before each drift, so that what an electron falls back to never depends on the
+electron the thread drifted before it (and so on the number of threads). Failed lookups and fallbacks are counted here
+(common/drift_profile.hh).
+*/
+
+namespace SafeFieldState
+{
+  // Electron being drifted on this thread; a last good field from another electron is not used
+  inline thread_local uint64_t electron = 1;
+}
+
+// Starts a new electron on the calling thread: every SafeField forgets the last good field of the one before
+inline void SafeFieldNewElectron() { ++SafeFieldState::electron; }
+
+template <class Model>
+class SafeField : public Garfield::Component
+{
+public:
+  explicit SafeField(Model *model) : Component("SafeField"), model(model)
+  {
+    m_ready = model != nullptr;
+  }
+
+  void SetGas(Garfield::Medium *m) { model->SetGas(m); }
+
+  using Component::ElectricField;
+
+  void ElectricField(const double x, const double y, const double z,
+                     double &ex, double &ey, double &ez, Garfield::Medium *&m, int &status) override
+  {
+    double v = 0.;
+    ElectricField(x, y, z, ex, ey, ez, v, m, status);
+  }
+
+  void ElectricField(const double x, const double y, const double z,
+                     double &ex, double &ey, double &ez, double &v,
+                     Garfield::Medium *&m, int &status) override
+  {
+    model->ElectricField(x, y, z, ex, ey, ez, v, m, status);
+
+    LastField &last = Last();
+    if (status == 0)
+    {
+      last = {ex, ey, ez, v, m, SafeFieldState::electron};
+      return;
+    }
+    DriftProfile::Count(&DriftCounters::fieldFailures);
+    if (last.electron != SafeFieldState::electron)
+      return;
+    DriftProfile::Count(&DriftCounters::fallbacks);
+    ex = last.ex;
+    ey = last.ey;
+    ez = last.ez;
+    v = last.v;
+    m = last.m;
+    status = 0;
+  }
+
+  double ElectricPotential(const double x, const double y, const double z) override
+  {
+    return model->ElectricPotential(x, y, z);
+  }
+
+  Garfield::Medium *GetMedium(const double x, const double y, const double z) override
+  {
+    return model->GetMedium(x, y, z);
+  }
+
+  bool GetVoltageRange(double &vmin, double &vmax) override { return model->GetVoltageRange(vmin, vmax); }
+
+  bool GetBoundingBox(double &xmin, double &ymin, double &zmin,
+                      double &xmax, double &ymax, double &zmax) override
+  {
+    return model->GetBoundingBox(xmin, ymin, zmin, xmax, ymax, zmax);
+  }
+
+private:
+  // Pure virtual in Garfield::Component; the model under it is reset and checked by its owner
+  void Reset() override {}
+  void UpdatePeriodicity() override {}
+
+  struct LastField
+  {
+    double ex = 0.0;
+    double ey = 0.0;
+    double ez = 0.0;
+    double v = 0.0;
+    Garfield::Medium *m = nullptr;
+    uint64_t electron = 0; // SafeFieldState::electron when it was taken
+  };
+
+  // Slot of this SafeField on the calling thread. Consecutive calls almost always come from the same SafeField, so
+  // the map is only searched when that changes. Ids are never reused, unlike addresses.
+  LastField &Last() const
+  {
+    thread_local uint64_t lastOwner = 0;
+    thread_local LastField *last = nullptr;
+    if (lastOwner != id)
+    {
+      thread_local std::unordered_map<uint64_t, LastField> fields;
+      last = &fields[id];
+      lastOwner = id;
+    }
+    return *last;
+  }
+
+  static inline std::atomic<uint64_t> nextId{1};
+
+  Model *model;
+  const uint64_t id = nextId++;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SCALED_FIELD_HH
+#define SCALED_FIELD_HH
+
+#include <algorithm>
+
+#include "Garfield/Component.hh"
+#include "Garfield/Medium.hh"
+
+#include "drift_profile.hh"
+
+/*
+Electrostatics is linear: if every electrode voltage is a fixed fraction of the HV, the potential map for HV = V is the
+reference map times V / V_ref. ScaledField wraps one reference solution and serves its field and potential multiplied
+by that factor, so any voltage (including ones never exported from COMSOL, like 1603 V) comes from a single model.
+efield_study/check_scaled_field.C compares it against the per-voltage exports.
+
+Model is any component with SetGas (ComponentComsol, ComsolSnapshot, FieldGridCache, SafeField). Several ScaledFields
+can share one reference; the reference is only read. As the component the sensor asks, it is where field calls are
+counted and, when enabled, timed (common/drift_profile.hh).
+*/
+
+template <class Model>
+class ScaledField : public Garfield::Component
+{
+public:
+  ScaledField(Model *reference, double referenceVoltage, double voltage)
+      : Component("ScaledField"), reference(reference), referenceVoltage(referenceVoltage)
+  {
+    SetVoltage(voltage);
+  }
+
+  void SetVoltage(double voltage)
+  {
+    scale = voltage / referenceVoltage;
+    m_ready = reference != nullptr;
+  }
+
+  double GetScale() const { return scale; }
+
+  // The gas lives in the reference model
+  void SetGas(Garfield::Medium *m) { reference->SetGas(m); }
+
+  using Component::ElectricField;
+
+  void ElectricField(const double x, const double y, const double z,
+                     double &ex, double &ey, double &ez, Garfield::Medium *&m, int &status) override
+  {
+    double v = 0.;
+    ElectricField(x, y, z, ex, ey, ez, v, m, status);
+  }
+
+  void ElectricField(const double x, const double y, const double z,
+                     double &ex, double &ey, double &ez, double &v,
+                     Garfield::Medium *&m, int &status) override
+  {
+    DriftProfile::ScopedTimer timer(&DriftCounters::fieldCalls, &DriftCounters::fieldNs);
+    reference->ElectricField(x, y, z, ex, ey, ez, v, m, status);
+    ex *= scale;
+    ey *= scale;
+    ez *= scale;
+    v *= scale;
+  }
+
+  double ElectricPotential(const double x, const double y, const double z) override
+  {
+    return scale * reference->ElectricPotential(x, y, z);
+  }
+
+  Garfield::Medium *GetMedium(const double x, const double y, const double z) override
+  {
+    return reference->GetMedium(x, y, z);
+  }
+
+  bool GetVoltageRange(double &vmin, double &vmax) override
+  {
+    if (!reference->GetVoltageRange(vmin, vmax))
+      return false;
+    vmin *= scale;
+    vmax *= scale;
+    if (vmin > vmax)
+      std::swap(vmin, vmax);
+    return true;
+  }
+
+  bool GetBoundingBox(double &xmin, double &ymin, double &zmin,
+                      double &xmax, double &ymax, double &zmax) override
+  {
+    return reference->GetBoundingBox(xmin, ymin, zmin, xmax, ymax, zmax);
+  }
+
+private:
+  // Pure virtual in Garfield::Component; the reference is shared and only read
+  void Reset() override {}
+  void UpdatePeriodicity() override {}
+
+  Model *reference;
+  double referenceVoltage;
+  double scale = 1.;
+};
+
+#endif
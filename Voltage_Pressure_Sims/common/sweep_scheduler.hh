@@ -0,0 +1,414 @@
+#ifndef SWEEP_SCHEDULER_HH
+#define SWEEP_SCHEDULER_HH
+
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+
+/*
+Runs the (voltage, pressure) points of a sweep on a pool of forked worker processes. The workers are forked after the
+model is loaded, so they share its pages, and stay alive between points. Every finished point is checkpointed in a
+ledger file; points already in the ledger are skipped, so a crashed or killed sweep resumes where it stopped.
+
+A point that runs past the timeout gets SIGTERM. The job can see this through SweepScheduler::StopRequested() and write
+what it has so far before returning false. If it is still running after the grace period it gets SIGKILL.
+
+Workers write the ledger entry of their point themselves. A job that appends its result to a shared file does so with
+SweepScheduler::AppendResult, which writes the result and the ledger entry under the ledger lock, so that a point whose
+result is out is never run (and written) again, whatever happens to the parent or the worker afterwards.
+*/
+
+struct SweepJob
+{
+  int voltage;
+  double pressure;
+};
+
+// Appends a line to a file with a single write under an exclusive lock, so that lines from jobs finishing at the same
+// time never interleave. Set sync to make sure the line is on disk before returning.
+inline bool AppendLine(const std::string &fileName, const std::string &line, bool sync = false)
+{
+  int fd = open(fileName.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0)
+    return false;
+
+  const std::string text = line + "\n";
+  flock(fd, LOCK_EX);
+  ssize_t written = write(fd, text.data(), text.size());
+  if (sync)
+    fsync(fd);
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  return written == static_cast<ssize_t>(text.size());
+}
+
+class SweepScheduler
+{
+public:
+  SweepScheduler(const std::string &ledgerFileName, int nWorkers, int timeoutSeconds, int graceSeconds = 60)
+      : ledgerFileName(ledgerFileName), nWorkers(std::max(1, nWorkers)),
+        timeout(timeoutSeconds), grace(graceSeconds), states(ReadLedger(ledgerFileName))
+  {
+  }
+
+  // True once a point is done, or stopped by the timeout with its partial result saved
+  bool IsFinished(const SweepJob &job) const
+  {
+    auto it = states.find(Key(job));
+    return it != states.end() && Finished(it->second);
+  }
+
+  // Set in a worker when its point runs out of time. Jobs should poll this and save what they have.
+  static bool StopRequested() { return stopFlag.load(std::memory_order_relaxed); }
+
+  // Appends the result line of the running point to fileName and records the point as done (or partial) in the
+  // ledger, both under the ledger lock. A worker killed between the two writes leaves the line without a ledger entry,
+  // so a rerun runs the point again and appends a second line for it. Outside a sweep worker this is AppendLine.
+  static bool AppendResult(const std::string &fileName, const std::string &line, bool complete)
+  {
+    if (current.ledgerFileName.empty())
+      return AppendLine(fileName, line);
+
+    int fd = open(current.ledgerFileName.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+      return false;
+    flock(fd, LOCK_EX);
+    bool written = AppendLine(fileName, line, true) && WriteEntry(fd, complete ? "done" : "partial");
+    flock(fd, LOCK_UN);
+    close(fd);
+    current.recorded = true;
+    return written;
+  }
+
+  // Runs every unfinished job. work() is called inside a worker process and returns false if it stopped early.
+  // Returns the number of jobs that did not finish.
+  int Run(const std::vector<SweepJob> &jobs, const std::function<bool(const SweepJob &)> &work)
+  {
+    std::vector<size_t> pending;
+    for (size_t i = jobs.size(); i-- > 0;)
+    {
+      if (!IsFinished(jobs[i]))
+        pending.push_back(i); // popped from the back, so jobs still run in order
+    }
+    if (pending.empty())
+      return 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    std::vector<Worker> workers(std::min<size_t>(nWorkers, pending.size()));
+    int nFailed = 0;
+
+    // Workers record their own points; the parent only writes the entry of a worker that died without reporting,
+    // unless that worker got its result out before it died
+    auto finish = [&](Worker &worker, std::string state, bool reported)
+    {
+      const SweepJob &job = jobs[worker.job];
+      if (!reported)
+      {
+        const auto recorded = ReadLedger(ledgerFileName);
+        auto it = recorded.find(Key(job));
+        if (it != recorded.end() && Finished(it->second))
+        {
+          state = it->second;
+        }
+        else
+        {
+          double seconds = std::chrono::duration<double>(Clock::now() - worker.start).count();
+          std::ostringstream entry;
+          entry << Key(job) << "," << state << "," << seconds;
+          AppendLine(ledgerFileName, entry.str(), true);
+        }
+      }
+      states[Key(job)] = state;
+      if (state != "done")
+      {
+        std::cerr << "Point V = " << job.voltage << ", P = " << job.pressure << " ended as " << state << "\n";
+        nFailed++;
+      }
+      worker.job = -1;
+    };
+
+    while (true)
+    {
+      // Hand the next job to every idle worker, replacing workers that have exited
+      bool busy = false;
+      for (auto &worker : workers)
+      {
+        if (worker.job < 0 && !pending.empty())
+        {
+          if (worker.pid < 0 && !Spawn(worker, workers, jobs, work))
+            continue;
+          worker.job = pending.back();
+          worker.start = Clock::now();
+          worker.terminated = false;
+          int64_t index = worker.job;
+          if (write(worker.jobFd, &index, sizeof(index)) != sizeof(index))
+          {
+            // Worker died while idle; put the job back and replace the worker
+            pending.push_back(worker.job);
+            worker.job = -1;
+            Reap(worker);
+            continue;
+          }
+          pending.pop_back();
+        }
+        busy = busy || worker.job >= 0;
+      }
+      if (!busy)
+      {
+        if (pending.empty())
+          break;
+        std::cerr << "Could not start any sweep worker\n";
+        return nFailed + static_cast<int>(pending.size());
+      }
+
+      // Sleep until a worker reports or the nearest deadline passes
+      auto now = Clock::now();
+      auto wait = std::chrono::milliseconds::max();
+      std::vector<pollfd> fds;
+      std::vector<Worker *> polled;
+      for (auto &worker : workers)
+      {
+        if (worker.job < 0)
+          continue;
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(Deadline(worker) - now);
+        wait = std::min(wait, std::max(left, std::chrono::milliseconds(0)));
+        fds.push_back({worker.resultFd, POLLIN, 0});
+        polled.push_back(&worker);
+      }
+      poll(fds.data(), fds.size(), static_cast<int>(std::min<int64_t>(wait.count(), 1 << 30)));
+
+      for (size_t i = 0; i < fds.size(); ++i)
+      {
+        Worker &worker = *polled[i];
+        if (fds[i].revents != 0)
+        {
+          int32_t state = 0;
+          if (read(worker.resultFd, &state, sizeof(state)) == sizeof(state))
+          {
+            finish(worker, state == 0 ? "done" : (state == 1 ? "partial" : "failed"), true);
+            // A worker that was stopped or failed exits after reporting; do not reuse it
+            if (state != 0)
+              Reap(worker);
+          }
+          else
+          {
+            finish(worker, worker.terminated ? "killed" : "crashed", false);
+            Reap(worker);
+          }
+        }
+        else if (Clock::now() >= Deadline(worker))
+        {
+          if (!worker.terminated)
+          {
+            std::cerr << "Timeout for V = " << jobs[worker.job].voltage << ", P = " << jobs[worker.job].pressure
+                      << ", asking worker to stop\n";
+            kill(worker.pid, SIGTERM);
+            worker.terminated = true;
+            worker.stopTime = Clock::now();
+          }
+          else
+          {
+            kill(worker.pid, SIGKILL); // reported as killed once its pipe closes
+            worker.stopTime = Clock::now();
+          }
+        }
+      }
+    }
+
+    // Closing the job pipes tells idle workers to exit
+    for (auto &worker : workers)
+      Reap(worker);
+
+    return nFailed;
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Worker
+  {
+    pid_t pid = -1;
+    int jobFd = -1;    // parent -> worker: index of the next job
+    int resultFd = -1; // worker -> parent: 0 done, 1 stopped early, 2 failed
+    long job = -1;
+    bool terminated = false;
+    Clock::time_point start;
+    Clock::time_point stopTime;
+  };
+
+  // Point a worker process is running, for AppendResult
+  struct CurrentJob
+  {
+    std::string ledgerFileName; // empty outside a worker
+    std::string key;
+    Clock::time_point start;
+    bool recorded;
+  };
+
+  static inline std::atomic<bool> stopFlag{false};
+  static inline CurrentJob current;
+
+  static void OnTerminate(int) { stopFlag.store(true); }
+
+  static std::string Key(const SweepJob &job)
+  {
+    std::ostringstream key;
+    key << job.voltage << "," << std::setprecision(12) << job.pressure;
+    return key.str();
+  }
+
+  static bool Finished(const std::string &state) { return state == "done" || state == "partial"; }
+
+  // Ledger lines are "voltage,pressure,state,seconds"; the last entry for a point wins
+  static std::map<std::string, std::string> ReadLedger(const std::string &fileName)
+  {
+    std::map<std::string, std::string> entries;
+    std::ifstream ledger(fileName);
+    std::string line;
+    while (std::getline(ledger, line))
+    {
+      std::istringstream fields(line);
+      std::string voltage, pressure, state;
+      if (std::getline(fields, voltage, ',') && std::getline(fields, pressure, ',') && std::getline(fields, state, ','))
+        entries[voltage + "," + pressure] = state;
+    }
+    return entries;
+  }
+
+  // Ledger entry of the running point, written and synced through an open (and locked) ledger
+  static bool WriteEntry(int fd, const std::string &state)
+  {
+    double seconds = std::chrono::duration<double>(Clock::now() - current.start).count();
+    std::ostringstream entry;
+    entry << current.key << "," << state << "," << seconds << "\n";
+    const std::string text = entry.str();
+    bool written = write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+    fsync(fd);
+    return written;
+  }
+
+  Clock::time_point Deadline(const Worker &worker) const
+  {
+    return worker.terminated ? worker.stopTime + std::chrono::seconds(grace) : worker.start + std::chrono::seconds(timeout);
+  }
+
+  bool Spawn(Worker &worker, std::vector<Worker> &workers, const std::vector<SweepJob> &jobs,
+             const std::function<bool(const SweepJob &)> &work)
+  {
+    int jobPipe[2], resultPipe[2];
+    if (pipe(jobPipe) != 0)
+      return false;
+    if (pipe(resultPipe) != 0)
+    {
+      close(jobPipe[0]);
+      close(jobPipe[1]);
+      return false;
+    }
+
+    std::cout.flush();
+    std::cerr.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+      std::cerr << "Fork failed\n";
+      for (int fd : {jobPipe[0], jobPipe[1], resultPipe[0], resultPipe[1]})
+        close(fd);
+      return false;
+    }
+
+    if (pid == 0)
+    {
+      // Worker process: drop the pipes of the other workers and serve jobs until the parent closes the job pipe
+      for (auto &other : workers)
+      {
+        if (other.jobFd >= 0)
+          close(other.jobFd);
+        if (other.resultFd >= 0)
+          close(other.resultFd);
+      }
+      close(jobPipe[1]);
+      close(resultPipe[0]);
+      signal(SIGTERM, OnTerminate);
+      current.ledgerFileName = ledgerFileName;
+
+      int64_t index;
+      while (read(jobPipe[0], &index, sizeof(index)) == sizeof(index))
+      {
+        int32_t state = 2;
+        stopFlag.store(false);
+        current.key = Key(jobs[index]);
+        current.start = Clock::now();
+        current.recorded = false;
+        try
+        {
+          state = work(jobs[index]) ? 0 : 1;
+        }
+        catch (const std::exception &e)
+        {
+          std::cerr << "Job failed: " << e.what() << "\n";
+        }
+        // Jobs that did not call AppendResult are recorded here, before the parent hears about them
+        if (!current.recorded)
+        {
+          int fd = open(ledgerFileName.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+          if (fd >= 0)
+          {
+            flock(fd, LOCK_EX);
+            WriteEntry(fd, state == 0 ? "done" : (state == 1 ? "partial" : "failed"));
+            flock(fd, LOCK_UN);
+            close(fd);
+          }
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        if (write(resultPipe[1], &state, sizeof(state)) != sizeof(state) || state != 0)
+          break;
+      }
+      // Skip destructors: threads of a stopped job may still be running
+      _exit(0);
+    }
+
+    close(jobPipe[0]);
+    close(resultPipe[1]);
+    worker.pid = pid;
+    worker.jobFd = jobPipe[1];
+    worker.resultFd = resultPipe[0];
+    worker.job = -1;
+    return true;
+  }
+
+  static void Reap(Worker &worker)
+  {
+    if (worker.pid < 0)
+      return;
+    close(worker.jobFd);
+    close(worker.resultFd);
+    int status;
+    waitpid(worker.pid, &status, 0);
+    worker = Worker();
+  }
+
+  std::string ledgerFileName;
+  int nWorkers;
+  int timeout;
+  int grace;
+  std::map<std::string, std::string> states;
+};
+
+#endif
@@ -6,7 +6,7 @@ Plots the electric field vs z for the center of PUMA.
 """
 if __name__ == "__main__":
     # Load the data
-    z, efield = np.loadtxt("Efield_vs_z_avg_HV1900.txt", unpack=True)
+    z, efield = np.loadtxt("Efield_vs_z_avg_HV1900.txt", usecols=(0, 1), unpack=True) # from probe_efield.C
 
     # Plot
     plt.figure(figsize=(8, 6))
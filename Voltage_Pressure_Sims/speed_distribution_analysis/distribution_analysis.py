@@ -1,7 +1,8 @@
-import ROOT
 import numpy as np
 import matplotlib.pyplot as plt
 
+from electron_records import read_columns
+
 """
 Looking at vdr vs distance to understand why the speed distribution is bimodal.
 """
@@ -12,36 +13,32 @@ if __name__ == "__main__":
     colors = ['purple', 'blue', 'green', 'red']  # Define colors for each voltage
 
     for i, voltage in enumerate(voltages):
-        title = "root_files/vdr_distance_P1498_V" + str(voltage) + ".root"
-        file = ROOT.TFile.Open(title)
-        graph = file.Get("vdr_distance")
-
-        # Get the distances
-        n_points = graph.GetN()
-    
-        # Get pointers arrays
-        x_array = graph.GetX()
-        y_array = graph.GetY()
-        
-        # Convert to Python lists
-        distances = [np.abs(x_array[i]) for i in range(n_points)]
-        distances_rounded = [round(x_array[i], 2) for i in range(n_points)] # Round distances (a lot of distance values are close)
-        unique_distances = set(distances_rounded)
-        vdr = [y_array[i] for i in range(n_points)]
+        records = read_columns(f"vdr_distance_P1498_V{voltage}.elec") # written by vdr_distributions.C
+        drifted = records["t1"] > records["t0"] # failed drifts are recorded too
+
+        # Straight-line distance and drift velocity of every electron
+        dx = records["x1"][drifted] - records["x0"][drifted]
+        dy = records["y1"][drifted] - records["y0"][drifted]
+        dz = records["z1"][drifted] - records["z0"][drifted]
+        distances = np.abs(dz)
+        vdr = np.sqrt(dx**2 + dy**2 + dz**2) / (records["t1"][drifted] - records["t0"][drifted]) * 1e3 # [cm/us]
+
+        # Full speed distribution (this used to be rendered by vdr_distributions.C for every point)
+        fig_all, ax_all = plt.subplots(figsize=(10, 6))
+        ax_all.hist(vdr, bins=1000, color='gray')
+        ax_all.set_xlabel('Drift Velocity [cm/μs]')
+        ax_all.set_ylabel('Counts')
+        ax_all.set_title(f'Drift Velocity Distribution in Argon - HV={voltage} V')
+        fig_all.savefig(f'raw_speed_distributions/argon_drift_speed_P1498_V{voltage}.png')
+        plt.close(fig_all)
 
         plt.scatter(distances, vdr, color=colors[i], label=f"HV={voltage} V")
 
-        # Define arrays for velocities corresponding to short and long distances
-        short_vdr = []
-        long_vdr = []
-
         # We want to separarate the drift velocities based on the distance travelled
-        for j, distance in enumerate(distances):
-            short_d, long_d = 3.85, 4.04 # The two unique distances found above
-            if np.abs(np.abs(distance) - short_d) < np.abs(np.abs(distance) - long_d): # if we are closer to short distance
-                short_vdr.append(vdr[j])
-            else:
-                long_vdr.append(vdr[j])
+        short_d, long_d = 3.85, 4.04 # The two unique distances found above
+        is_short = np.abs(distances - short_d) < np.abs(distances - long_d) # closer to short distance
+        short_vdr = vdr[is_short]
+        long_vdr = vdr[~is_short]
 
         # Histograms for short and long distances overlaid
         fig_hist2, ax = plt.subplots(figsize=(10, 6))
@@ -56,10 +53,6 @@ if __name__ == "__main__":
         plt.savefig(f'velocity_distribution_HV{voltage}V_short_distance.png', dpi=300, bbox_inches='tight')
         plt.close()  # Closes the figure to free memory
 
-
-        # Close the file
-        file.Close()
-
     plt.title("Drift Velocity vs Distance Travelled in Argon")
     plt.xlabel("Distance [cm]")
     plt.ylabel("Drift Velocity [cm/μs]")
@@ -0,0 +1,64 @@
+import mmap
+import numpy as np
+
+"""
+Reader for the per-electron files (.elec) written by common/electron_record_writer.hh. The file is memory-mapped and
+every column of every chunk comes back as a numpy view into the mapping, so nothing is copied until asked for.
+"""
+
+
+def read_chunks(path):
+    """
+    Maps an electron record file.
+
+    :param path: path to the .elec file
+    :returns: list of chunks, each a dict of column name -> numpy array (views into the mapped file)
+    """
+    with open(path, "rb") as f:
+        data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)  # stays mapped while any view is alive
+
+    if data[:8] != b"PUMAELEC":
+        raise ValueError(f"{path} is not an electron record file")
+    version, n_columns, _ = np.frombuffer(data, dtype="<u4", count=3, offset=8)
+    if version != 1:
+        raise ValueError(f"{path}: unsupported version {version}")
+
+    columns = []
+    for c in range(n_columns):
+        entry = data[32 + 32 * c: 64 + 32 * c]
+        name = entry[:16].split(b"\0")[0].decode()
+        dtype = np.dtype(entry[16:24].split(b"\0")[0].decode())
+        columns.append((name, dtype))
+
+    chunks = []
+    offset = 32 + 32 * n_columns
+    while offset + 16 <= len(data) and data[offset:offset + 4] == b"CHNK":
+        n = int(np.frombuffer(data, dtype="<u4", count=1, offset=offset + 4)[0])
+        position = offset + 16
+        chunk = {}
+        for name, dtype in columns:
+            size = (n * dtype.itemsize + 7) // 8 * 8
+            if position + size > len(data):  # last chunk cut off by a killed run
+                return chunks
+            chunk[name] = np.frombuffer(data, dtype=dtype, count=n, offset=position)
+            position += size
+        chunks.append(chunk)
+        offset = position
+    return chunks
+
+
+def read_columns(path, names=None):
+    """
+    Reads whole columns of an electron record file. A file with a single chunk is returned without copying.
+
+    :param path: path to the .elec file
+    :param names: columns to return (default: all)
+    :returns: dict of column name -> numpy array
+    """
+    chunks = read_chunks(path)
+    if not chunks:
+        return {}
+    names = names if names is not None else list(chunks[0].keys())
+    if len(chunks) == 1:
+        return {name: chunks[0][name] for name in names}
+    return {name: np.concatenate([chunk[name] for chunk in chunks]) for name in names}